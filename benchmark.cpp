@@ -0,0 +1,265 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "generator.cpp"
+
+// Measures how compile time and peak memory of the compiler grow with the
+// size of the input program. Programs of doubling size are compiled, the cost
+// of compiling a trivial program is subtracted and a power law is fitted to
+// the rest. Fails if either exponent exceeds the allowed one, and is
+// inconclusive if the costs do not rise above the baseline.
+//
+// By default only the number of statements grows. Other sweeps grow another
+// parameter along with the size instead:
+//
+// *   depth: each loop nest spans a quarter of the program
+//
+// Deep nests are still parsed and compiled recursively, so the depth sweep
+// stops at the first program that the compiler fails on and fits the
+// programs before it.
+// *   variables: the program uses a quarter as many variables as statements
+// *   terms: 16 statements whose values have up to an eighth of the size terms
+
+enum Sweep {
+    sweep_size = 0,
+    sweep_depth = 1,
+    sweep_variables = 2,
+    sweep_terms = 3,
+};
+
+struct Measurement {
+    double seconds;
+    double kilobytes;
+};
+
+struct Benchmark {
+    const char* compiler;
+    const char* path;
+    int depth;
+    int variables;
+    int subtractions;
+    int terms;
+    int shape;
+    int repeat;
+    int sweep;
+
+    Benchmark(const char* comp, const char* pat) : compiler(comp), path(pat),
+        depth(2), variables(16), subtractions(50), terms(4), shape(shape_nested), repeat(3), sweep(sweep_size) {}
+
+    // compiles the program in `path' once, returns false if the compiler failed
+    bool run(Measurement* measurement) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            return false;
+        } else if (pid == 0) {
+            int input = open(this->path, O_RDONLY);
+            int output = open("/dev/null", O_WRONLY);
+            if (input < 0 || output < 0) {
+                _exit(127);
+            }
+            dup2(input, 0);
+            dup2(output, 1);
+            execl(this->compiler, this->compiler, (char*) NULL);
+            _exit(127);
+        }
+        int status;
+        struct rusage usage;
+        if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            return false;
+        }
+        measurement->seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+            usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+        // ru_maxrss is given in kilobytes on Linux
+        measurement->kilobytes = usage.ru_maxrss;
+        return true;
+    }
+
+    // the depth of the loop nests in a program of the given size
+    int depth_of(int size) {
+        return this->sweep == sweep_depth ? std::max(1, size / 4) : this->depth;
+    }
+
+    // the best of `repeat' runs for a program of the given size
+    bool measure(int size, Measurement* best) {
+        std::ofstream out(this->path);
+        int statements = size;
+        int depth = depth_of(size);
+        int variables = this->variables;
+        int terms = this->terms;
+        if (this->sweep == sweep_variables) {
+            variables = std::max(1, size / 4);
+        } else if (this->sweep == sweep_terms) {
+            statements = 16;
+            terms = std::max(1, size / 8);
+        }
+        ProgramGenerator generator(statements, depth, variables, this->subtractions, terms, this->shape, 1);
+        generator.generate(out);
+        out.close();
+        if (!out) {
+            return false;
+        }
+        for (int i = 0; i < this->repeat; ++i) {
+            Measurement measurement;
+            if (!run(&measurement)) {
+                return false;
+            }
+            if (i == 0 || measurement.seconds < best->seconds) {
+                best->seconds = measurement.seconds;
+            }
+            if (i == 0 || measurement.kilobytes < best->kilobytes) {
+                best->kilobytes = measurement.kilobytes;
+            }
+        }
+        return true;
+    }
+};
+
+// least squares fit of log(cost - baseline) against log(size), returns the
+// exponent or NAN if fewer than two costs exceed the baseline
+double exponent(const std::vector<double> & sizes, const std::vector<double> & costs, double baseline) {
+    std::vector<double> xs, ys;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        if (costs[i] > baseline) {
+            xs.push_back(log(sizes[i]));
+            ys.push_back(log(costs[i] - baseline));
+        }
+    }
+    if (xs.size() < 2) {
+        return NAN;
+    }
+    double n = xs.size(), sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (size_t i = 0; i < xs.size(); ++i) {
+        sx += xs[i];
+        sy += ys[i];
+        sxx += xs[i] * xs[i];
+        sxy += xs[i] * ys[i];
+    }
+    return (n * sxy - sx * sy) / (n * sxx - sx * sx);
+}
+
+int usage(const char* name) {
+    fprintf(stderr, "Usage: %s <compiler> [--from <size>] [--to <size>] [--sweep size|depth|variables|terms]\n"
+        "    [--depth <depth>] [--variables <variables>] [--subtractions <percent>] [--terms <terms>]\n"
+        "    [--shape nested|direct|fusible|constant] [--repeat <runs>] [--max-exponent <exponent>]\n", name);
+    return 2;
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        return usage(argv[0]);
+    }
+    char path[] = "/tmp/loop-benchmark-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "Fatal: Could not create temporary file.\n");
+        return 2;
+    }
+    close(fd);
+    Benchmark benchmark(argv[1], path);
+    // the defaults depend on the sweep
+    int from = -1;
+    int to = -1;
+    double max_exponent = 1.2;
+    for (int i = 2; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            unlink(path);
+            return usage(argv[0]);
+        } else if (strcmp(argv[i], "--from") == 0) {
+            from = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--to") == 0) {
+            to = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--sweep") == 0 && strcmp(argv[i + 1], "size") == 0) {
+            benchmark.sweep = sweep_size;
+        } else if (strcmp(argv[i], "--sweep") == 0 && strcmp(argv[i + 1], "depth") == 0) {
+            benchmark.sweep = sweep_depth;
+        } else if (strcmp(argv[i], "--sweep") == 0 && strcmp(argv[i + 1], "variables") == 0) {
+            benchmark.sweep = sweep_variables;
+        } else if (strcmp(argv[i], "--sweep") == 0 && strcmp(argv[i + 1], "terms") == 0) {
+            benchmark.sweep = sweep_terms;
+        } else if (strcmp(argv[i], "--depth") == 0) {
+            benchmark.depth = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--variables") == 0) {
+            benchmark.variables = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--subtractions") == 0) {
+            benchmark.subtractions = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--terms") == 0) {
+            benchmark.terms = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--shape") == 0) {
+            benchmark.shape = parse_shape(argv[i + 1]);
+        } else if (strcmp(argv[i], "--repeat") == 0) {
+            benchmark.repeat = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--max-exponent") == 0) {
+            max_exponent = atof(argv[i + 1]);
+        } else {
+            unlink(path);
+            return usage(argv[0]);
+        }
+    }
+    if (from == -1) {
+        from = benchmark.sweep == sweep_depth ? 1024 : 16384;
+    }
+    if (to == -1) {
+        to = benchmark.sweep == sweep_depth ? 16384 : 262144;
+    }
+    if (from < 1 || to < 2 * from || benchmark.repeat < 1 || benchmark.depth < 0 || benchmark.variables < 1 ||
+            benchmark.subtractions < 0 || benchmark.subtractions > 100 || benchmark.terms < 1 || benchmark.shape < 0) {
+        unlink(path);
+        return usage(argv[0]);
+    }
+
+    // the cost of starting the compiler at all
+    Measurement baseline;
+    if (!benchmark.measure(1, &baseline)) {
+        fprintf(stderr, "Fatal: Could not run `%s'.\n", benchmark.compiler);
+        unlink(path);
+        return 2;
+    }
+    printf("%12s %12s %12s\n", "size", "seconds", "peak kB");
+    printf("%12d %12.3f %12.0f\n", 1, baseline.seconds, baseline.kilobytes);
+    std::vector<double> sizes, seconds, kilobytes;
+    for (int size = from; size <= to; size *= 2) {
+        Measurement measurement;
+        if (!benchmark.measure(size, &measurement)) {
+            if (benchmark.sweep == sweep_depth && !sizes.empty()) {
+                printf("`%s' failed on a program of size %d, it supports loop nests of depth %d\n",
+                    benchmark.compiler, size, benchmark.depth_of((int) sizes.back()));
+                break;
+            }
+            fprintf(stderr, "Fatal: `%s' failed on a program of size %d.\n", benchmark.compiler, size);
+            unlink(path);
+            return 2;
+        }
+        printf("%12d %12.3f %12.0f\n", size, measurement.seconds, measurement.kilobytes);
+        sizes.push_back(size);
+        seconds.push_back(measurement.seconds);
+        kilobytes.push_back(measurement.kilobytes);
+    }
+    unlink(path);
+
+    double time_exponent = exponent(sizes, seconds, baseline.seconds);
+    double memory_exponent = exponent(sizes, kilobytes, baseline.kilobytes);
+    printf("time grows with exponent %.2f, peak memory with exponent %.2f (allowed: %.2f)\n",
+        time_exponent, memory_exponent, max_exponent);
+    // NAN compares unequal to itself
+    if (time_exponent != time_exponent || memory_exponent != memory_exponent) {
+        printf("INCONCLUSIVE: the costs do not rise above the baseline, try larger programs\n");
+        return 2;
+    }
+    if (time_exponent > max_exponent || memory_exponent > max_exponent) {
+        printf("FAIL: compilation scales super-linearly\n");
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
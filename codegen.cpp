@@ -32,49 +32,63 @@ Value* IdentifierAST::codegen(CodeGenerator* generator) {
 }
 
 Value* ValueAST::codegen(CodeGenerator* generator) {
-    Value* lhs_val = this->lhs->codegen(generator);
-    Value* rhs_val = this->rhs->codegen(generator);
-    if (lhs_val == NULL || rhs_val == NULL) {
-        return NULL;
-    } else {
-        switch (this->op) {
-            case '+': {
-                return generator->builder.CreateAdd(lhs_val, rhs_val);
-            } case '-': {
-                IRBuilder<>& builder = generator->builder;
-                // calculate exact result (might be negative)
-                Value* exact = builder.CreateSub(lhs_val, rhs_val);
-                // create condition
-                Value* condition = builder.CreateICmpSLT(exact,
-                    ConstantInt::get(getGlobalContext(), APInt(32, 0)), "ifcond");
-                // create if/then/else blocks
-                Function* fun = builder.GetInsertBlock()->getParent();
-                BasicBlock* then_block = BasicBlock::Create(getGlobalContext(), "then", fun);
-                BasicBlock* else_block = BasicBlock::Create(getGlobalContext(), "else");
-                BasicBlock* merge_block = BasicBlock::Create(getGlobalContext(), "ifmerge");
-                // create conditional branch
-                builder.CreateCondBr(condition, then_block, else_block);
-                // fill in then block, i.e. normalize to 0
-                builder.SetInsertPoint(then_block);
-                Value* then_value = ConstantInt::get(getGlobalContext(), APInt(32, 0));
-                builder.CreateBr(merge_block);
-                // fill in else block, i.e. return exact result
-                then_block = builder.GetInsertBlock();
-                fun->getBasicBlockList().push_back(else_block);
-                builder.SetInsertPoint(else_block);
-                builder.CreateBr(merge_block);
-                else_block = builder.GetInsertBlock();
-                // fill in merge block
-                fun->getBasicBlockList().push_back(merge_block);
-                builder.SetInsertPoint(merge_block);
-                PHINode* phi = builder.CreatePHI(Type::getInt32Ty(getGlobalContext()), "iftmp");
-                phi->addIncoming(then_value, then_block);
-                phi->addIncoming(exact, else_block);
-                return phi;
-            } default: {
-                const char msg[2] = { this->op, '\0' };
-                return generator->error("Unknown operator", msg);
-            }
+    // values are nested to the left, walk them iteratively so that long
+    // values do not exhaust the stack
+    std::vector<ValueAST*> chain;
+    ExprAST* leftmost = this;
+    while (leftmost->kind == ast_value) {
+        chain.push_back(static_cast<ValueAST*>(leftmost));
+        leftmost = chain.back()->lhs;
+    }
+    Value* lhs_val = leftmost->codegen(generator);
+    for (size_t i = chain.size(); i > 0; --i) {
+        Value* rhs_val = chain[i - 1]->rhs->codegen(generator);
+        if (lhs_val == NULL || rhs_val == NULL) {
+            return NULL;
+        }
+        lhs_val = chain[i - 1]->apply(generator, lhs_val, rhs_val);
+    }
+    return lhs_val;
+}
+
+Value* ValueAST::apply(CodeGenerator* generator, Value* lhs_val, Value* rhs_val) {
+    switch (this->op) {
+        case '+': {
+            return generator->builder.CreateAdd(lhs_val, rhs_val);
+        } case '-': {
+            IRBuilder<>& builder = generator->builder;
+            // calculate exact result (might be negative)
+            Value* exact = builder.CreateSub(lhs_val, rhs_val);
+            // create condition
+            Value* condition = builder.CreateICmpSLT(exact,
+                ConstantInt::get(getGlobalContext(), APInt(32, 0)), "ifcond");
+            // create if/then/else blocks
+            Function* fun = builder.GetInsertBlock()->getParent();
+            BasicBlock* then_block = BasicBlock::Create(getGlobalContext(), "then", fun);
+            BasicBlock* else_block = BasicBlock::Create(getGlobalContext(), "else");
+            BasicBlock* merge_block = BasicBlock::Create(getGlobalContext(), "ifmerge");
+            // create conditional branch
+            builder.CreateCondBr(condition, then_block, else_block);
+            // fill in then block, i.e. normalize to 0
+            builder.SetInsertPoint(then_block);
+            Value* then_value = ConstantInt::get(getGlobalContext(), APInt(32, 0));
+            builder.CreateBr(merge_block);
+            // fill in else block, i.e. return exact result
+            then_block = builder.GetInsertBlock();
+            fun->getBasicBlockList().push_back(else_block);
+            builder.SetInsertPoint(else_block);
+            builder.CreateBr(merge_block);
+            else_block = builder.GetInsertBlock();
+            // fill in merge block
+            fun->getBasicBlockList().push_back(merge_block);
+            builder.SetInsertPoint(merge_block);
+            PHINode* phi = builder.CreatePHI(Type::getInt32Ty(getGlobalContext()), "iftmp");
+            phi->addIncoming(then_value, then_block);
+            phi->addIncoming(exact, else_block);
+            return phi;
+        } default: {
+            const char msg[2] = { this->op, '\0' };
+            return generator->error("Unknown operator", msg);
         }
     }
 }
@@ -133,11 +147,18 @@ Value* AssignAST::codegen(CodeGenerator* generator) {
 }
 
 Value* SequenceAST::codegen(CodeGenerator* generator) {
-    Value* lhs_value = lhs->codegen(generator);
-    if (lhs_value == NULL) {
-        return NULL;
-    } else {
-        return rhs->codegen(generator);
+    // sequences are nested to the right, walk them iteratively so that long
+    // programs do not exhaust the stack
+    SequenceAST* sequence = this;
+    while (true) {
+        Value* lhs_value = sequence->lhs->codegen(generator);
+        if (lhs_value == NULL) {
+            return NULL;
+        } else if (sequence->rhs->kind != ast_sequence) {
+            return sequence->rhs->codegen(generator);
+        } else {
+            sequence = static_cast<SequenceAST*>(sequence->rhs);
+        }
     }
 }
 
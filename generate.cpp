@@ -0,0 +1,51 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include "generator.cpp"
+
+int usage(const char* name) {
+    fprintf(stderr, "Usage: %s <statements> [--depth <depth>] [--variables <variables>]\n"
+        "    [--subtractions <percent>] [--terms <terms>] [--shape nested|direct|fusible|constant] [--seed <seed>]\n", name);
+    return 1;
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 2 || argc % 2 != 0) {
+        return usage(argv[0]);
+    }
+    int statements = atoi(argv[1]);
+    int depth = 2;
+    int variables = 16;
+    int subtractions = 50;
+    int terms = 4;
+    int shape = shape_nested;
+    unsigned int seed = 1;
+    for (int i = 2; i < argc; i += 2) {
+        if (strcmp(argv[i], "--depth") == 0) {
+            depth = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--variables") == 0) {
+            variables = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--subtractions") == 0) {
+            subtractions = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--terms") == 0) {
+            terms = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--shape") == 0) {
+            shape = parse_shape(argv[i + 1]);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = atoi(argv[i + 1]);
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (statements < 0 || depth < 0 || variables < 1 || subtractions < 0 || subtractions > 100 ||
+            terms < 1 || shape < 0) {
+        fprintf(stderr, "Fatal: Invalid arguments.\n");
+        return 1;
+    }
+    ProgramGenerator generator(statements, depth, variables, subtractions, terms, shape, seed);
+    generator.generate(std::cout);
+    return 0;
+}
@@ -0,0 +1,195 @@
+
+// Generates LOOP programs of a given size to stress the compiler.
+//
+// After initializing all variables, the program consists of loop nests of the
+// given depth. The shape decides what a nest looks like:
+//
+// *   nested: each level holds an assignment to its own variable before the
+//     next loop, the innermost body holds a block of assignments
+// *   direct: the loops are nested directly, `loop x do loop y do ...', the
+//     innermost body holds a block of assignments
+// *   fusible: the loops are nested directly, the innermost body holds a run
+//     of loops with the same count, each of which only touches its own
+//     variable, so that all of them can be fused
+// *   constant: like nested, but the counts are constants and the assignment
+//     at each level only reads `n', so that it can be hoisted out of the
+//     whole nest
+//
+// Every value mixes up to the given number of terms, and the given percentage
+// of its operators are subtractions, which are the most expensive operator to
+// generate code for.
+enum Shape {
+    shape_nested = 0,
+    shape_direct = 1,
+    shape_fusible = 2,
+    shape_constant = 3,
+};
+
+// the shape with the given name or -1
+int parse_shape(const char* name) {
+    if (strcmp(name, "nested") == 0) {
+        return shape_nested;
+    } else if (strcmp(name, "direct") == 0) {
+        return shape_direct;
+    } else if (strcmp(name, "fusible") == 0) {
+        return shape_fusible;
+    } else if (strcmp(name, "constant") == 0) {
+        return shape_constant;
+    } else {
+        return -1;
+    }
+}
+
+struct ProgramGenerator {
+    int statements;
+    int depth;
+    int variables;
+    int subtractions;
+    int terms;
+    int shape;
+    unsigned int seed;
+    // if not -1, values may only use this variable and `n'
+    int own;
+    // if set, values may only use `n'
+    bool invariant;
+
+    // number of statements in the innermost body of each loop nest
+    static const int block = 8;
+
+    ProgramGenerator(int stmts, int dep, int vars, int subs, int trms, int shap, unsigned int s) :
+        statements(stmts), depth(dep), variables(vars), subtractions(subs), terms(trms), shape(shap),
+        seed(s), own(-1), invariant(false) {}
+
+    // linear congruential generator, so that programs do not depend on the C
+    // library. Only the upper 16 bits of a step are random enough, so two
+    // steps make up a number.
+    int random(int bound) {
+        unsigned int value = 0;
+        for (int i = 0; i < 2; ++i) {
+            this->seed = this->seed * 1103515245 + 12345;
+            value = (value << 16) | (this->seed >> 16);
+        }
+        return value % bound;
+    }
+
+    void variable(std::ostream & out) {
+        if (this->invariant) {
+            out << "n";
+        } else if (this->own == -1) {
+            out << "v" << random(this->variables);
+        } else if (random(2) == 0) {
+            out << "v" << this->own;
+        } else {
+            out << "n";
+        }
+    }
+
+    // <term> := <number> | <identifier> | <parens>
+    void term(std::ostream & out, bool parens) {
+        int choice = random(8);
+        if (choice == 0) {
+            out << random(10);
+        } else if (choice == 1 && parens) {
+            out << "(";
+            value(out, false);
+            out << ")";
+        } else {
+            variable(out);
+        }
+    }
+
+    // <value> := <value> + <term> | <value> - <term> | <term>
+    //
+    // Values in parentheses have at most four terms, so that the size of the
+    // program grows linearly with the number of terms.
+    void value(std::ostream & out, bool parens) {
+        int count = 1 + random(parens ? this->terms : std::min(this->terms, 4));
+        term(out, parens);
+        for (int i = 1; i < count; ++i) {
+            if (random(100) < this->subtractions) {
+                out << " - ";
+            } else {
+                out << " + ";
+            }
+            term(out, parens);
+        }
+    }
+
+    // <assignment> := <identifier> = <value>
+    void assignment(std::ostream & out) {
+        variable(out);
+        out << " = ";
+        value(out, true);
+    }
+
+    // a run of loops with the same count, each of which only touches its
+    // own variable
+    void run(std::ostream & out, int loops) {
+        std::ostringstream count;
+        if (random(2) == 0) {
+            count << "n";
+        } else {
+            count << 1 + random(9);
+        }
+        int first = random(this->variables);
+        for (int i = 0; i < loops; ++i) {
+            this->own = (first + i) % this->variables;
+            out << "loop " << count.str() << " do v" << this->own << " = ";
+            value(out, true);
+            out << " end";
+            if (i + 1 < loops) {
+                out << ";\n";
+            }
+        }
+        this->own = -1;
+    }
+
+    void generate(std::ostream & out) {
+        // define all variables up front, code generation rejects undefined ones
+        for (int i = 0; i < this->variables; ++i) {
+            out << "v" << i << " = n;\n";
+        }
+        // a run of fusible loops needs a variable for each of them
+        int width = block;
+        if (this->shape == shape_fusible) {
+            width = std::min(block, this->variables);
+        }
+        int left = this->statements;
+        while (left > 0) {
+            int nest = std::min(left, this->depth + width);
+            int levels = std::min(this->depth, nest - 1);
+            for (int level = 0; level < levels; ++level) {
+                out << "loop ";
+                if (this->shape == shape_constant) {
+                    out << 1 + random(9);
+                } else {
+                    term(out, false);
+                }
+                out << " do\n";
+                if (this->shape == shape_nested || this->shape == shape_constant) {
+                    out << "v" << level % this->variables << " = ";
+                    this->invariant = this->shape == shape_constant;
+                    value(out, true);
+                    this->invariant = false;
+                    out << ";\n";
+                }
+            }
+            if (this->shape == shape_fusible) {
+                run(out, nest - levels);
+            } else {
+                for (int i = levels; i < nest; ++i) {
+                    assignment(out);
+                    if (i + 1 < nest) {
+                        out << ";\n";
+                    }
+                }
+            }
+            for (int level = 0; level < levels; ++level) {
+                out << "\nend";
+            }
+            out << ";\n";
+            left -= nest;
+        }
+        out << "f = v0\n";
+    }
+};
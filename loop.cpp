@@ -11,13 +11,18 @@
 #include "llvm/Support/IRBuilder.h"
 #include "llvm/Support/raw_ostream.h"
 #include <cstdio>
+#include <cstring>
 #include <algorithm>
 #include <string>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <deque>
+#include <vector>
+#include <climits>
 #include "lexer.cpp"
 #include "parser.cpp"
+#include "transform.cpp"
 #include "codegen.cpp"
 
 using namespace llvm;
@@ -61,6 +66,12 @@ int main(int argc, char ** argv) {
     CodeGenerator generator(module, &fpm);
     TopLevelAST* toplevel = parser.parseToplevel();
     if (toplevel != NULL) {
+        // Fuse, collapse and hoist loops before generating code, unless the
+        // program is to be compiled as written.
+        if (argc < 2 || strcmp(argv[1], "--no-transform") != 0) {
+            LoopTransformer transformer;
+            toplevel = toplevel->transform(&transformer);
+        }
         Value* toplevel_value = toplevel->codegen(&generator);
 
         // print header
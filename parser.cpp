@@ -1,23 +1,49 @@
 using namespace llvm;
 struct CodeGenerator;
+struct LoopTransformer;
+
+enum ASTKind {
+    ast_number = 0,
+    ast_identifier = 1,
+    ast_value = 2,
+    ast_loop = 3,
+    ast_assign = 4,
+    ast_sequence = 5,
+    ast_toplevel = 6,
+};
+
+// how often a variable is read and written
+struct Usage {
+    int reads;
+    int writes;
+    Usage() : reads(0), writes(0) {}
+};
+
+typedef std::map<std::string, Usage> Variables;
 
 struct ExprAST {
+    const int kind;
+    ExprAST(int k) : kind(k) {}
     virtual ~ExprAST() {}
     virtual Value* codegen(CodeGenerator* generator) = 0;
+    // counts the reads and writes of each variable in this expression
+    virtual void variables(Variables* variables) = 0;
 };
 
 // <number> := [0-9]+
 struct NumberAST : public ExprAST {
     int value;
-    NumberAST(int val) : value(val) {}
+    NumberAST(int val) : ExprAST(ast_number), value(val) {}
     virtual Value* codegen(CodeGenerator* generator);
+    virtual void variables(Variables* variables);
 };
 
 // <identifier> := [a-z][a-z0-9]*
 struct IdentifierAST : public ExprAST {
     std::string name;
-    IdentifierAST(std::string nam) : name(nam) {}
+    IdentifierAST(std::string nam) : ExprAST(ast_identifier), name(nam) {}
     virtual Value* codegen(CodeGenerator* generator);
+    virtual void variables(Variables* variables);
 };
 
 // <value> := <value> + <term> | <value> - <term>
@@ -25,44 +51,75 @@ struct ValueAST : public ExprAST {
     char op;
     ExprAST* lhs;
     ExprAST* rhs;
-    ValueAST(ExprAST* l, char o, ExprAST* r) : op(o), lhs(l), rhs(r) {}
-    virtual ~ValueAST() { delete lhs; delete rhs; }
+    ValueAST(ExprAST* l, char o, ExprAST* r) : ExprAST(ast_value), op(o), lhs(l), rhs(r) {}
+    virtual ~ValueAST() {
+        delete rhs;
+        // unlink the values nested to the left one by one, so that long
+        // values do not exhaust the stack
+        ExprAST* next = lhs;
+        while (next != NULL && next->kind == ast_value) {
+            ValueAST* value = static_cast<ValueAST*>(next);
+            next = value->lhs;
+            value->lhs = NULL;
+            delete value;
+        }
+        delete next;
+    }
     virtual Value* codegen(CodeGenerator* generator);
+    Value* apply(CodeGenerator* generator, Value* lhs_val, Value* rhs_val);
+    virtual void variables(Variables* variables);
 };
 
 // <loop> := loop <value> do <expression> end
 struct LoopAST : public ExprAST {
     ExprAST* argument;
     ExprAST* body;
-    LoopAST(ExprAST* arg, ExprAST* b) : argument(arg), body(b) {}
+    LoopAST(ExprAST* arg, ExprAST* b) : ExprAST(ast_loop), argument(arg), body(b) {}
     virtual ~LoopAST() { delete argument; delete body; }
     virtual Value* codegen(CodeGenerator* generator);
+    virtual void variables(Variables* variables);
 };
 
 // <assignment> := <identifier> = <value>
 struct AssignAST : public ExprAST {
     IdentifierAST* identifier;
     ExprAST* value;
-    AssignAST(IdentifierAST* ident, ExprAST* val) : identifier(ident), value(val) {}
+    AssignAST(IdentifierAST* ident, ExprAST* val) : ExprAST(ast_assign), identifier(ident), value(val) {}
     virtual ~AssignAST() { delete value; delete identifier; }
     virtual Value* codegen(CodeGenerator* generator);
+    virtual void variables(Variables* variables);
 };
 
 // <expression> := <expression> ; <expression>
 struct SequenceAST : public ExprAST {
     ExprAST* lhs;
     ExprAST* rhs;
-    SequenceAST(ExprAST* l, ExprAST* r) : lhs(l), rhs(r) {}
-    virtual ~SequenceAST() { delete lhs; delete rhs; }
+    SequenceAST(ExprAST* l, ExprAST* r) : ExprAST(ast_sequence), lhs(l), rhs(r) {}
+    virtual ~SequenceAST() {
+        delete lhs;
+        // unlink the sequences nested to the right one by one, so that long
+        // programs do not exhaust the stack
+        ExprAST* next = rhs;
+        while (next != NULL && next->kind == ast_sequence) {
+            SequenceAST* sequence = static_cast<SequenceAST*>(next);
+            next = sequence->rhs;
+            sequence->rhs = NULL;
+            delete sequence;
+        }
+        delete next;
+    }
     virtual Value* codegen(CodeGenerator* generator);
+    virtual void variables(Variables* variables);
 };
 
 // <toplevel> := ';' | <expression>
 struct TopLevelAST : public ExprAST {
     ExprAST* expression;
-    TopLevelAST(ExprAST* exp) : expression(exp) {}
+    TopLevelAST(ExprAST* exp) : ExprAST(ast_toplevel), expression(exp) {}
     virtual ~TopLevelAST() { delete expression; }
     virtual Function* codegen(CodeGenerator* generator);
+    virtual void variables(Variables* variables);
+    TopLevelAST* transform(LoopTransformer* transformer);
 };
 
 struct Parser {
@@ -110,23 +167,32 @@ struct Parser {
 
     // <expression> := <expression> ; <expression> | <assignment> | <loop>
     ExprAST* parseExpression() {
-        ExprAST* lhs;
-        if (token.type == tok_loop) {
-            lhs = parseLoop();
-        } else if (token.type == tok_ident) {
-            lhs = parseAssignment();
-        } else if (token.type == tok_eof) {
-            return lhs;
-        } else {
-            lhs = error(token.type, "an expression");
-        }
-        if (token.type == tok_sep) {
+        // collect the statements iteratively, so that long programs do not
+        // exhaust the stack
+        std::vector<ExprAST*> statements;
+        while (true) {
+            if (token.type == tok_loop) {
+                statements.push_back(parseLoop());
+            } else if (token.type == tok_ident) {
+                statements.push_back(parseAssignment());
+            } else if (token.type == tok_eof) {
+                break;
+            } else {
+                statements.push_back(error(token.type, "an expression"));
+            }
+            if (token.type != tok_sep) {
+                break;
+            }
             eat();
-            ExprAST* rhs = parseExpression();
-            return new SequenceAST(lhs, rhs);
-        } else {
-            return lhs;
         }
+        if (statements.empty()) {
+            return NULL;
+        }
+        ExprAST* expression = statements.back();
+        for (size_t i = statements.size() - 1; i > 0; --i) {
+            expression = new SequenceAST(statements[i - 1], expression);
+        }
+        return expression;
     }
 
     // <assignment> := <identifier> = <value>
@@ -149,13 +215,9 @@ struct Parser {
     }
 
     // <value> := <value> + <term> | <value> - <term> | <term>
-    ExprAST* parseValue(ExprAST* lhs = NULL) {
-        if (lhs == NULL) {
-            lhs = parseTerm();
-        }
-        if (token.type != tok_plus && token.type != tok_minus) {
-            return lhs;
-        } else {
+    ExprAST* parseValue() {
+        ExprAST* lhs = parseTerm();
+        while (token.type == tok_plus || token.type == tok_minus) {
             char op;
             if (token.type == tok_plus) {
                 op = '+';
@@ -164,14 +226,9 @@ struct Parser {
             }
             eat();
             ExprAST* rhs = parseTerm();
-            ValueAST* value = new ValueAST(lhs, op, rhs);
-            // upwards recursion
-            if (token.type == tok_plus || token.type == tok_minus) {
-                return parseValue(value);
-            } else {
-                return value;
-            }
+            lhs = new ValueAST(lhs, op, rhs);
         }
+        return lhs;
     }
 
     // <parens> := (<value>)
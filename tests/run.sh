@@ -0,0 +1,41 @@
+#!/bin/sh
+# Compiles every program listed in tests/expected with and without the loop
+# transformations, runs it for the given n and compares the resulting f. If a
+# line gives a fourth number, it is the number of loops that the transformed
+# program must be left with.
+#
+#     tests/run.sh [<compiler>]
+#
+# Run it from the repository root, where the compiler finds header.s.
+compiler=${1:-./loop}
+work=$(mktemp -d) || exit 2
+trap 'rm -rf "$work"' EXIT
+failures=0
+while read program n expected loops; do
+    for flag in "" --no-transform; do
+        if ! $compiler $flag < "tests/$program" > "$work/prog.ll" ||
+                ! llvm-as < "$work/prog.ll" | llc > "$work/prog.s" ||
+                ! clang "$work/prog.s" -o "$work/prog"; then
+            echo "FAIL: $program${flag:+ $flag} does not compile"
+            failures=$((failures + 1))
+            continue
+        fi
+        actual=$("$work/prog" "$n" | sed 's/.*evaluated to: //')
+        if [ "$actual" != "$expected" ]; then
+            echo "FAIL: $program${flag:+ $flag} for n=$n: expected $expected, got $actual"
+            failures=$((failures + 1))
+        fi
+        # every loop gets a block of its own to check its counter
+        if [ -z "$flag" ] && [ -n "$loops" ]; then
+            actual=$(grep -c '^loopcondition[0-9]*:' "$work/prog.ll")
+            if [ "$actual" != "$loops" ]; then
+                echo "FAIL: $program: expected $loops loops, got $actual"
+                failures=$((failures + 1))
+            fi
+        fi
+    done
+done < tests/expected
+if [ $failures -ne 0 ]; then
+    exit 1
+fi
+echo PASS
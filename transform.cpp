@@ -0,0 +1,651 @@
+
+// Loop transformations, applied to the AST before code generation.
+//
+// Each transformation is guarded by a dependency analysis over the variables
+// that the statements involved read and write:
+//
+// *   fusion merges adjacent loops with equal count expressions whose bodies
+//     are independent of each other
+// *   collapsing turns `loop x do loop y do ... end end` with constant counts
+//     into a single loop
+// *   hoisting moves loop-invariant assignments out of the loop body
+//
+// Loop unswitching is not implemented, as LOOP has no conditionals that could
+// be moved out of a loop.
+//
+// The program is transformed in two passes, the first one fusing and
+// collapsing loops bottom-up, the second one hoisting assignments. Fusion
+// hands the read and write counts of a statement up to the enclosing one
+// instead of analysing the statement again at every level. Counts are merged
+// by adding the smaller map to the larger one, so that a program with n
+// occurrences of variables is analysed in O(n log n) map operations, however
+// deeply its loops are nested. Hoisting looks up the positions at which each
+// variable is read and written instead, and moves each assignment to its
+// final place in one step, in O(n log n log d) for loops nested d deep.
+//
+// Both passes walk loop nests with an explicit stack.
+
+// the state of fusing the statements of one body, see LoopTransformer::fuse
+struct Fusion {
+    // the loop whose body this is, NULL for the whole program
+    LoopAST* loop;
+    std::vector<ExprAST*> statements;
+    // the statement to continue with
+    size_t next;
+    // the statements fused so far and their counts
+    std::vector<ExprAST*> fused;
+    Variables variables;
+    // the run of loops being fused, its first loop, the bodies to append to
+    // it and the counts of all of them
+    LoopAST* first;
+    std::vector<ExprAST*> bodies;
+    Variables first_variables;
+
+    Fusion(LoopAST* l) : loop(l), next(0), first(NULL) {}
+};
+
+// bodies to append to the body of a loop, see LoopTransformer::extend
+struct Extension {
+    LoopAST* loop;
+    std::vector<ExprAST*> bodies;
+
+    Extension(LoopAST* l) : loop(l) {}
+};
+
+// where a variable is read and written, see LoopTransformer::number
+struct Occurrences {
+    // the positions of the statements that read and write the variable
+    std::vector<int> reads;
+    std::vector<int> writes;
+    // for each write, the level of the outermost loop that the assignment is
+    // hoisted out of, INT_MAX if it is not hoisted
+    std::vector<int> levels;
+};
+
+// the state of hoisting the statements of one body, see LoopTransformer::hoist
+struct Body {
+    // the loop whose body this is, NULL for the whole program
+    LoopAST* loop;
+    std::vector<ExprAST*> statements;
+    // the positions of the loop and of the last statement in its body
+    int start;
+    int end;
+    // the statement to continue with
+    size_t next;
+    // the levels of the outermost loops on the stack that statements and
+    // temporaries in this body may be hoisted out of
+    size_t outermost;
+    size_t reach;
+    // the statements left in the body and the statements and temporaries
+    // hoisted out of the loop
+    std::vector<ExprAST*> kept;
+    std::vector<ExprAST*> hoisted;
+    std::vector<ExprAST*> temporaries;
+
+    Body(LoopAST* l) : loop(l), start(0), end(0), next(0), outermost(0), reach(0) {}
+};
+
+struct LoopTransformer {
+    int temporaries;
+    std::map<std::string, Occurrences> occurrences;
+
+    LoopTransformer() {
+        this->temporaries = 0;
+    }
+
+    // temporaries start with `_', so they never clash with an identifier
+    // that the lexer produced
+    std::string temporary() {
+        char name[32];
+        snprintf(name, sizeof(name), "_trip%d", this->temporaries++);
+        return name;
+    }
+
+    // adds the counts in `from' to the ones in `into' and clears `from'
+    void merge(Variables* into, Variables* from) {
+        if (into->size() < from->size()) {
+            into->swap(*from);
+        }
+        for (Variables::iterator it = from->begin(); it != from->end(); ++it) {
+            Usage& usage = (*into)[it->first];
+            usage.reads += it->second.reads;
+            usage.writes += it->second.writes;
+        }
+        from->clear();
+    }
+
+    // true if neither side writes a variable that the other one touches
+    bool independent(const Variables & a, const Variables & b) {
+        const Variables & smaller = a.size() < b.size() ? a : b;
+        const Variables & larger = a.size() < b.size() ? b : a;
+        for (Variables::const_iterator it = smaller.begin(); it != smaller.end(); ++it) {
+            Variables::const_iterator other = larger.find(it->first);
+            if (other != larger.end() && (it->second.writes != 0 || other->second.writes != 0)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // structural equality of two values
+    bool equal(ExprAST* a, ExprAST* b) {
+        // values are nested to the left, walk them iteratively
+        while (a != NULL && b != NULL && a->kind == ast_value && b->kind == ast_value) {
+            ValueAST* lhs = static_cast<ValueAST*>(a);
+            ValueAST* rhs = static_cast<ValueAST*>(b);
+            if (lhs->op != rhs->op || !equal(lhs->rhs, rhs->rhs)) {
+                return false;
+            }
+            a = lhs->lhs;
+            b = rhs->lhs;
+        }
+        if (a == NULL || b == NULL || a->kind != b->kind) {
+            return false;
+        }
+        switch (a->kind) {
+            case ast_number: {
+                return static_cast<NumberAST*>(a)->value == static_cast<NumberAST*>(b)->value;
+            } case ast_identifier: {
+                return static_cast<IdentifierAST*>(a)->name == static_cast<IdentifierAST*>(b)->name;
+            } default: {
+                return false;
+            }
+        }
+    }
+
+    // appends the statements of a sequence to the list and deletes the
+    // sequence nodes themselves, handing ownership of the statements to the list
+    void flatten(ExprAST* expression, std::vector<ExprAST*>* statements) {
+        // sequences are nested to the right, walk them iteratively
+        while (expression != NULL && expression->kind == ast_sequence) {
+            SequenceAST* sequence = static_cast<SequenceAST*>(expression);
+            flatten(sequence->lhs, statements);
+            expression = sequence->rhs;
+            sequence->lhs = NULL;
+            sequence->rhs = NULL;
+            delete sequence;
+        }
+        statements->push_back(expression);
+    }
+
+    // <expression> ; <expression> ; ... from a non-empty list of statements
+    ExprAST* sequence(const std::vector<ExprAST*> & statements) {
+        ExprAST* result = statements.back();
+        for (size_t i = statements.size() - 1; i > 0; --i) {
+            result = new SequenceAST(statements[i - 1], result);
+        }
+        return result;
+    }
+
+    // appends the fused bodies to the body of the loop
+    //
+    // The bodies are independent of each other, so loops that meet where one
+    // body ends and the next one begins may be fused as well if they run
+    // equally often, and so on for the bodies of those loops.
+    void extend(LoopAST* loop, std::vector<ExprAST*>* bodies) {
+        std::deque<Extension> extensions;
+        extensions.push_back(Extension(loop));
+        extensions.back().bodies.swap(*bodies);
+        while (!extensions.empty()) {
+            Extension extension = Extension(extensions.front().loop);
+            extension.bodies.swap(extensions.front().bodies);
+            extensions.pop_front();
+            std::vector<ExprAST*> statements;
+            flatten(extension.loop->body, &statements);
+            // the loop at the end of the statements and the bodies fused into it
+            Extension last = Extension(NULL);
+            for (size_t i = 0; i < extension.bodies.size(); ++i) {
+                std::vector<ExprAST*> next;
+                flatten(extension.bodies[i], &next);
+                size_t first = 0;
+                if (statements.back() != NULL && statements.back()->kind == ast_loop &&
+                        next[0] != NULL && next[0]->kind == ast_loop) {
+                    LoopAST* lhs = static_cast<LoopAST*>(statements.back());
+                    LoopAST* rhs = static_cast<LoopAST*>(next[0]);
+                    if (equal(lhs->argument, rhs->argument)) {
+                        if (last.loop != lhs) {
+                            last = Extension(lhs);
+                        }
+                        last.bodies.push_back(rhs->body);
+                        rhs->body = NULL;
+                        delete rhs;
+                        first = 1;
+                    }
+                }
+                if (first < next.size() && !last.bodies.empty()) {
+                    extensions.push_back(Extension(last.loop));
+                    extensions.back().bodies.swap(last.bodies);
+                }
+                statements.insert(statements.end(), next.begin() + first, next.end());
+            }
+            if (!last.bodies.empty()) {
+                extensions.push_back(Extension(last.loop));
+                extensions.back().bodies.swap(last.bodies);
+            }
+            extension.loop->body = sequence(statements);
+        }
+    }
+
+    // ends the run of loops being fused in the body
+    void close(Fusion* fusion) {
+        if (fusion->first == NULL) {
+            return;
+        }
+        if (!fusion->bodies.empty()) {
+            extend(fusion->first, &fusion->bodies);
+        }
+        merge(&fusion->variables, &fusion->first_variables);
+        fusion->first->argument->variables(&fusion->variables);
+        fusion->first = NULL;
+    }
+
+    // loop c do a end ; loop c do b end => loop c do a ; b end
+    //
+    // Two loops may be fused if they run equally often, neither body touches
+    // a variable the other one writes and the first body does not write the
+    // variables of the count. The counts of a run of fused bodies are
+    // accumulated, so that each body is only analysed once. Adds a statement
+    // to the body, `loop' is the statement if it is a loop and `counts' are
+    // the counts of the statement or of the body of the loop.
+    void add(Fusion* fusion, ExprAST* statement, LoopAST* loop, Variables* counts) {
+        if (fusion->first != NULL && loop != NULL && equal(fusion->first->argument, loop->argument)) {
+            Variables count;
+            loop->argument->variables(&count);
+            if (independent(fusion->first_variables, *counts) && independent(fusion->first_variables, count)) {
+                merge(&fusion->first_variables, counts);
+                fusion->bodies.push_back(loop->body);
+                loop->body = NULL;
+                delete loop;
+                return;
+            }
+        }
+        close(fusion);
+        fusion->fused.push_back(statement);
+        fusion->first = loop;
+        if (loop != NULL) {
+            fusion->first_variables.swap(*counts);
+        } else {
+            merge(&fusion->variables, counts);
+        }
+    }
+
+    // fuses and collapses the loops in the expression, innermost first
+    //
+    // Loop nests are walked with an explicit stack, so that deep nests do not
+    // exhaust the stack.
+    ExprAST* fuse(ExprAST* expression) {
+        std::vector<Fusion*> stack;
+        stack.push_back(new Fusion(NULL));
+        flatten(expression, &stack.back()->statements);
+        while (true) {
+            Fusion* fusion = stack.back();
+            if (fusion->next < fusion->statements.size()) {
+                ExprAST* statement = fusion->statements[fusion->next];
+                if (statement != NULL && statement->kind == ast_loop) {
+                    // continue with the body, the loop is added once it is done
+                    LoopAST* loop = static_cast<LoopAST*>(statement);
+                    stack.push_back(new Fusion(loop));
+                    flatten(loop->body, &stack.back()->statements);
+                    loop->body = NULL;
+                } else {
+                    Variables counts;
+                    if (statement != NULL) {
+                        statement->variables(&counts);
+                    }
+                    add(fusion, statement, NULL, &counts);
+                    fusion->next++;
+                }
+                continue;
+            }
+            close(fusion);
+            ExprAST* body = sequence(fusion->fused);
+            stack.pop_back();
+            if (stack.empty()) {
+                delete fusion;
+                return body;
+            }
+            fusion->loop->body = body;
+            LoopAST* loop = collapse(fusion->loop);
+            Fusion* parent = stack.back();
+            add(parent, loop, loop, &fusion->variables);
+            parent->next++;
+            delete fusion;
+        }
+    }
+
+    // loop x do loop y do b end end => loop x * y do b end
+    //
+    // Only for constant counts, which are multiplied at compile time. For
+    // other counts, the product would have to be summed up by a loop that runs
+    // as often as the outer one, which saves nothing.
+    LoopAST* collapse(LoopAST* outer) {
+        if (outer->body == NULL || outer->body->kind != ast_loop) {
+            return outer;
+        }
+        LoopAST* inner = static_cast<LoopAST*>(outer->body);
+        if (outer->argument->kind != ast_number || inner->argument->kind != ast_number) {
+            return outer;
+        }
+        long long product = (long long) static_cast<NumberAST*>(outer->argument)->value *
+            static_cast<NumberAST*>(inner->argument)->value;
+        if (product < 0 || product > INT_MAX) {
+            return outer;
+        }
+        LoopAST* collapsed = new LoopAST(new NumberAST((int) product), inner->body);
+        inner->body = NULL;
+        delete outer;
+        return collapsed;
+    }
+
+    // 1 if the loop counter in `name' is not 0, 0 otherwise. A loop runs
+    // (unsigned) count times, so a count that wrapped around to a negative
+    // number has to yield 1 as well:
+    //
+    // *   (t - 0) + (0 - t) is |t| for all t but INT_MIN, where it is 0
+    // *   (0 - (t + 1)) - 2147483646 is 1 for INT_MIN and 0 for all other t
+    ExprAST* nonzero(const std::string & name) {
+        ExprAST* magnitude = new ValueAST(
+            new ValueAST(new IdentifierAST(name), '-', new NumberAST(0)), '+',
+            new ValueAST(new NumberAST(0), '-', new IdentifierAST(name)));
+        ExprAST* positive = new ValueAST(new NumberAST(1), '-',
+            new ValueAST(new NumberAST(1), '-', magnitude));
+        ExprAST* minimum = new ValueAST(
+            new ValueAST(new NumberAST(0), '-',
+                new ValueAST(new IdentifierAST(name), '+', new NumberAST(1))), '-',
+            new NumberAST(2147483646));
+        return new ValueAST(positive, '+', minimum);
+    }
+
+    // records the reads of the variables at the given position
+    void record(const Variables & reads, int position) {
+        for (Variables::const_iterator it = reads.begin(); it != reads.end(); ++it) {
+            this->occurrences[it->first].reads.push_back(position);
+        }
+    }
+
+    // records a write of the variable at the given position
+    void record(const std::string & name, int position) {
+        Occurrences& occurrences = this->occurrences[name];
+        occurrences.writes.push_back(position);
+        occurrences.levels.push_back(INT_MAX);
+    }
+
+    // the number of positions in [from, to]
+    int count(const std::vector<int> & positions, int from, int to) {
+        return std::upper_bound(positions.begin(), positions.end(), to) -
+            std::lower_bound(positions.begin(), positions.end(), from);
+    }
+
+    // splits the expression into the body of the program, followed by the
+    // bodies of its loops in program order. Numbers the loops and assignments
+    // in program order and records where each variable is read and written.
+    void number(ExprAST* expression, std::vector<Body*>* bodies) {
+        bodies->push_back(new Body(NULL));
+        flatten(expression, &bodies->back()->statements);
+        std::vector<Body*> stack;
+        stack.push_back(bodies->back());
+        int position = 0;
+        while (!stack.empty()) {
+            Body* body = stack.back();
+            if (body->next == body->statements.size()) {
+                body->end = position;
+                body->next = 0;
+                stack.pop_back();
+                continue;
+            }
+            ExprAST* statement = body->statements[body->next++];
+            if (statement == NULL) {
+                continue;
+            }
+            Variables reads;
+            position++;
+            if (statement->kind == ast_loop) {
+                LoopAST* loop = static_cast<LoopAST*>(statement);
+                loop->argument->variables(&reads);
+                record(reads, position);
+                bodies->push_back(new Body(loop));
+                bodies->back()->start = position;
+                flatten(loop->body, &bodies->back()->statements);
+                loop->body = NULL;
+                stack.push_back(bodies->back());
+            } else {
+                AssignAST* assignment = static_cast<AssignAST*>(statement);
+                assignment->value->variables(&reads);
+                record(reads, position);
+                record(assignment->identifier->name, position);
+            }
+        }
+    }
+
+    // true if the variable does not change while the loop at the given level
+    // of the stack runs, given that it is read at `position': it is written at
+    // most once in the loop, before `position', by an assignment that is
+    // hoisted out of the loop as well
+    bool unchanged(const std::string & name, int position, const std::vector<Body*> & stack, size_t level) {
+        Occurrences& occurrences = this->occurrences[name];
+        std::vector<int>::iterator first = std::lower_bound(occurrences.writes.begin(), occurrences.writes.end(), stack[level]->start);
+        std::vector<int>::iterator last = std::upper_bound(first, occurrences.writes.end(), stack[level]->end);
+        if (last - first == 0) {
+            return true;
+        }
+        return last - first == 1 && *first < position &&
+            occurrences.levels[first - occurrences.writes.begin()] <= (int) level;
+    }
+
+    // true if the assignment at `position' may be hoisted out of the loop at
+    // the given level of the stack: nothing else in the loop writes x,
+    // nothing before it in the loop reads x and the variables it reads do not
+    // change while the loop runs
+    bool invariant(const std::string & name, const Variables & reads, int position, const std::vector<Body*> & stack, size_t level) {
+        Occurrences& occurrences = this->occurrences[name];
+        if (count(occurrences.writes, stack[level]->start, stack[level]->end) != 1 ||
+                count(occurrences.reads, stack[level]->start, position) != 0) {
+            return false;
+        }
+        for (Variables::const_iterator it = reads.begin(); it != reads.end(); ++it) {
+            if (!unchanged(it->first, position, stack, level)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // the level of the outermost loop on the stack, starting with the one at
+    // level `outermost', that the assignment at `position' may be hoisted out
+    // of, or 0 if it stays in place
+    //
+    // An assignment that may be hoisted out of a loop may be hoisted out of
+    // the loops nested in it as well, so the level is found by binary search.
+    size_t place(AssignAST* assignment, int position, const std::vector<Body*> & stack, size_t outermost) {
+        const std::string & name = assignment->identifier->name;
+        Variables reads;
+        assignment->value->variables(&reads);
+        size_t lowest = outermost;
+        size_t highest = stack.size() - 1;
+        if (lowest > highest || !invariant(name, reads, position, stack, highest)) {
+            return 0;
+        }
+        while (lowest < highest) {
+            size_t middle = (lowest + highest) / 2;
+            if (invariant(name, reads, position, stack, middle)) {
+                highest = middle;
+            } else {
+                lowest = middle + 1;
+            }
+        }
+        Occurrences& occurrences = this->occurrences[name];
+        size_t index = std::lower_bound(occurrences.writes.begin(), occurrences.writes.end(), position) -
+            occurrences.writes.begin();
+        occurrences.levels[index] = (int) highest;
+        return highest;
+    }
+
+    // hands the statements of a finished loop body to the body enclosing it
+    //
+    // loop c do a ; x = v ; b end => _trip = c ; loop nonzero(_trip) do x = v end ; loop _trip do a ; b end
+    //
+    // Unless c is a non-zero constant, c might be 0, so the hoisted
+    // assignments are guarded by a loop that runs at most once. If c is a
+    // variable that the loop does not write, it serves as the temporary.
+    // Temporaries are only read by their own loop and its guard, so they are
+    // dead whenever the loop does not run and are hoisted without a guard.
+    void finish(Body* body, const std::vector<Body*> & stack) {
+        LoopAST* loop = body->loop;
+        Body* parent = stack.back();
+        if (!body->hoisted.empty()) {
+            if (loop->argument->kind == ast_number) {
+                parent->kept.insert(parent->kept.end(), body->hoisted.begin(), body->hoisted.end());
+            } else {
+                std::string name;
+                if (loop->argument->kind == ast_identifier &&
+                        count(this->occurrences[static_cast<IdentifierAST*>(loop->argument)->name].writes, body->start, body->end) == 0) {
+                    name = static_cast<IdentifierAST*>(loop->argument)->name;
+                } else {
+                    name = temporary();
+                    AssignAST* trip = new AssignAST(new IdentifierAST(name), loop->argument);
+                    loop->argument = new IdentifierAST(name);
+                    record(name, body->start);
+                    size_t level = place(trip, body->start, stack, parent->reach);
+                    if (level == 0) {
+                        parent->kept.push_back(trip);
+                    } else {
+                        stack[level]->temporaries.push_back(trip);
+                    }
+                }
+                parent->kept.push_back(new LoopAST(nonzero(name), sequence(body->hoisted)));
+            }
+        }
+        // after the guard, which may write the variables they read
+        parent->kept.insert(parent->kept.end(), body->temporaries.begin(), body->temporaries.end());
+        if (body->kept.empty()) {
+            delete loop;
+        } else {
+            loop->body = sequence(body->kept);
+            parent->kept.push_back(loop);
+        }
+    }
+
+    // moves the invariant assignments out of the loops in the expression
+    //
+    // The loops and assignments are numbered in program order first, so that
+    // whether a variable is read or written inside a loop is a matter of
+    // looking up the positions between the start and the end of the loop.
+    // Each assignment is then moved to the outermost loop it may leave in one
+    // step. Loop nests are walked with an explicit stack, so that deep nests
+    // do not exhaust the stack.
+    ExprAST* hoist(ExprAST* expression) {
+        std::vector<Body*> bodies;
+        number(expression, &bodies);
+        std::vector<Body*> stack;
+        stack.push_back(bodies[0]);
+        // nothing is hoisted out of the program
+        stack.back()->outermost = 1;
+        stack.back()->reach = 1;
+        size_t loops = 0;
+        int position = 0;
+        while (true) {
+            Body* body = stack.back();
+            if (body->next < body->statements.size()) {
+                ExprAST* statement = body->statements[body->next++];
+                if (statement == NULL) {
+                    body->kept.push_back(statement);
+                } else if (statement->kind == ast_loop) {
+                    // continue with the body, the loop is handed up once it is done
+                    Body* inner = bodies[++loops];
+                    size_t level = stack.size();
+                    inner->reach = body->reach;
+                    if (inner->loop->argument->kind != ast_number) {
+                        // hoisting out of the loop is guarded, not out of the ones around it
+                        inner->outermost = level;
+                    } else if (static_cast<NumberAST*>(inner->loop->argument)->value == 0) {
+                        // never runs, nothing to hoist
+                        inner->outermost = level + 1;
+                        inner->reach = level + 1;
+                    } else {
+                        inner->outermost = body->outermost;
+                    }
+                    stack.push_back(inner);
+                    position++;
+                } else {
+                    position++;
+                    size_t level = place(static_cast<AssignAST*>(statement), position, stack, body->outermost);
+                    if (level == 0) {
+                        body->kept.push_back(statement);
+                    } else {
+                        stack[level]->hoisted.push_back(statement);
+                    }
+                }
+                continue;
+            }
+            stack.pop_back();
+            if (stack.empty()) {
+                ExprAST* result = sequence(body->kept);
+                for (size_t i = 0; i < bodies.size(); ++i) {
+                    delete bodies[i];
+                }
+                this->occurrences.clear();
+                return result;
+            }
+            finish(body, stack);
+        }
+    }
+};
+
+void NumberAST::variables(Variables* variables) {
+}
+
+void IdentifierAST::variables(Variables* variables) {
+    (*variables)[this->name].reads++;
+}
+
+void ValueAST::variables(Variables* variables) {
+    // values are nested to the left, walk them iteratively
+    ExprAST* expression = this;
+    while (expression != NULL && expression->kind == ast_value) {
+        ValueAST* value = static_cast<ValueAST*>(expression);
+        if (value->rhs != NULL) {
+            value->rhs->variables(variables);
+        }
+        expression = value->lhs;
+    }
+    if (expression != NULL) {
+        expression->variables(variables);
+    }
+}
+
+void LoopAST::variables(Variables* variables) {
+    this->argument->variables(variables);
+    if (this->body != NULL) {
+        this->body->variables(variables);
+    }
+}
+
+void AssignAST::variables(Variables* variables) {
+    this->value->variables(variables);
+    (*variables)[this->identifier->name].writes++;
+}
+
+void SequenceAST::variables(Variables* variables) {
+    // sequences are nested to the right, walk them iteratively
+    ExprAST* expression = this;
+    while (expression != NULL && expression->kind == ast_sequence) {
+        SequenceAST* sequence = static_cast<SequenceAST*>(expression);
+        if (sequence->lhs != NULL) {
+            sequence->lhs->variables(variables);
+        }
+        expression = sequence->rhs;
+    }
+    if (expression != NULL) {
+        expression->variables(variables);
+    }
+}
+
+void TopLevelAST::variables(Variables* variables) {
+    this->expression->variables(variables);
+}
+
+TopLevelAST* TopLevelAST::transform(LoopTransformer* transformer) {
+    this->expression = transformer->fuse(this->expression);
+    this->expression = transformer->hoist(this->expression);
+    return this;
+}